@@ -10,7 +10,8 @@
 // This works by maintaining a single Logger class that has various 
 // message destinations that are mapped to the message level (Info, Debug, Warning, Error)
 // E.g. for an Info message the Logger sends that message to all destinations
-// registered to handle Info. Valid destinations are File, Stdout and Stderr.
+// registered to handle Info. Valid destinations are File, Stdout, Stderr and, on Linux,
+// Socket for handing messages to a local log collector.
 //
 // Project url: https://github.com/WildCoastSolutions/Logging
 
@@ -32,6 +33,27 @@
 #include <iomanip>
 #include <time.h>
 #include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <atomic>
+#include <cstdint>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifdef __linux__
+#include <deque>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
 
 namespace Wild
 {
@@ -41,7 +63,8 @@ namespace Wild
         enum class DestinationType{
             Stdout,
             Stderr,
-            File
+            File,
+            Socket
         };
 
         // Levels supported for log messages
@@ -69,7 +92,15 @@ namespace Wild
         class Destination
         {
         public:
+            virtual ~Destination() {}
             virtual void Write(const std::string &s) = 0;
+
+            // Called by the Logger, destinations that care about the level of the message
+            // (e.g. to map it onto a syslog severity) can override this
+            virtual void Write(Level, const std::string &s) { Write(s); }
+
+            // Push out any messages the destination is holding on to
+            virtual void Flush() {}
         protected:
             std::mutex destinationMutex;    // Protect destinations from being written to at the same time
         };
@@ -124,11 +155,515 @@ namespace Wild
             }
         };
 
+#ifdef __linux__
+        // Kinds of socket a SocketDestination can send to
+        enum class SocketType{
+            UnixDatagram,   // address is a filesystem path
+            UnixStream,     // address is a filesystem path
+            Udp             // address is ipv4:port e.g. 127.0.0.1:514
+        };
+
+        // Wire formats a SocketDestination can send
+        enum class SocketFormat{
+            Native,         // same text as the file and console destinations
+            Syslog          // RFC 5424 with facility user, octet counted on stream sockets
+        };
+
+        // Socket destination, hands messages to a local log collector.
+        // Messages are queued and sent in batches with one sendmmsg call, either when the batch
+        // is full, when the oldest queued message is older than the flush interval (checked by a
+        // background thread, so a lone message still goes out) or when Flush is called.
+        // Sends never block, if the collector isn't there or can't keep up messages are held up
+        // to a limit and then dropped, see Dropped(). Reconnects back off from 100ms up to 30s.
+        // On a stream socket Syslog messages are octet counted (RFC 6587) while Native messages
+        // are split by the trailing newline, as in a log file, so values shouldn't contain newlines.
+        class SocketDestination : public Destination
+        {
+        public:
+
+            SocketDestination(
+                SocketType type,
+                const std::string &address,
+                SocketFormat format = SocketFormat::Native,
+                size_t batchSize = 64,
+                std::chrono::milliseconds flushInterval = std::chrono::milliseconds(1000)) :
+                m_type(type),
+                m_format(format),
+                m_batchSize(batchSize > 0 ? batchSize : 1),
+                m_maxQueued(m_batchSize * 16),
+                m_flushInterval(flushInterval),
+                m_socket(-1),
+                m_partial(0),
+                m_backoff(MinBackoff()),
+                m_nextConnect(std::chrono::steady_clock::now()),
+                m_dropped(0),
+                m_stopping(false)
+            {
+                std::memset(&m_address, 0, sizeof(m_address));
+                if (type == SocketType::Udp)
+                {
+                    auto colon = address.rfind(':');
+                    sockaddr_in &in = *reinterpret_cast<sockaddr_in *>(&m_address);
+                    in.sin_family = AF_INET;
+                    char *end = nullptr;
+                    long port = colon == std::string::npos ? 0 : std::strtol(address.c_str() + colon + 1, &end, 10);
+                    if (colon == std::string::npos ||
+                        inet_pton(AF_INET, address.substr(0, colon).c_str(), &in.sin_addr) != 1 ||
+                        end == address.c_str() + colon + 1 || *end != 0 || port < 1 || port > 65535)
+                        throw std::runtime_error("Couldn't parse socket address " + address);
+                    in.sin_port = htons(static_cast<uint16_t>(port));
+                    m_addressLength = sizeof(sockaddr_in);
+                }
+                else
+                {
+                    sockaddr_un &un = *reinterpret_cast<sockaddr_un *>(&m_address);
+                    if (address.empty() || address.size() >= sizeof(un.sun_path))
+                        throw std::runtime_error("Couldn't use socket path " + address);
+                    un.sun_family = AF_UNIX;
+                    std::memcpy(un.sun_path, address.c_str(), address.size());
+                    m_addressLength = sizeof(sockaddr_un);
+                }
+
+                if (format == SocketFormat::Syslog)
+                {
+                    char host[256] = "-";
+                    gethostname(host, sizeof(host) - 1);
+                    host[sizeof(host) - 1] = 0;
+                    m_syslogHeader = std::string(" ") + host + " " + program_invocation_short_name + " " +
+                        std::to_string(getpid()) + " - - ";
+                }
+
+                // A missing collector isn't fatal, we'll keep trying whenever there's something to send
+                {
+                    std::lock_guard<std::mutex> lock(destinationMutex);
+                    Connect();
+                }
+
+                if (m_flushInterval.count() > 0)
+                    m_flusher = std::thread([this]() { FlushPeriodically(); });
+            }
+
+            ~SocketDestination()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(destinationMutex);
+                    m_stopping = true;
+                }
+                m_wake.notify_one();
+                if (m_flusher.joinable()) m_flusher.join();
+
+                std::lock_guard<std::mutex> lock(destinationMutex);
+                Send();
+                m_dropped += m_queue.size();
+                Disconnect();
+            }
+
+            void Write(const std::string &s)
+            {
+                Write(Level::Info, s);
+            }
+
+            void Write(Level level, const std::string &s)
+            {
+                // Access to the output for this destination must be thread safe
+                std::lock_guard<std::mutex> lock(destinationMutex);
+                auto now = std::chrono::steady_clock::now();
+                if (m_queue.size() >= m_maxQueued)
+                {
+                    m_dropped++;
+                }
+                else
+                {
+                    if (m_queue.empty()) m_oldest = now;
+                    m_queue.push_back(m_format == SocketFormat::Syslog ? Syslog(level, s) : s);
+                }
+
+                if (m_queue.size() >= m_batchSize || now - m_oldest >= m_flushInterval)
+                    Send();
+            }
+
+            void Flush()
+            {
+                std::lock_guard<std::mutex> lock(destinationMutex);
+                Send();
+            }
+
+            // Number of messages thrown away because the collector was unavailable or too slow
+            uint64_t Dropped() const
+            {
+                return m_dropped;
+            }
+
+        private:
+
+            static std::chrono::milliseconds MinBackoff() { return std::chrono::milliseconds(100); }
+            static std::chrono::milliseconds MaxBackoff() { return std::chrono::milliseconds(30000); }
+
+            // Runs on m_flusher, sends messages that have waited a flush interval without the batch filling
+            void FlushPeriodically()
+            {
+                std::unique_lock<std::mutex> lock(destinationMutex);
+                while (!m_stopping)
+                {
+                    m_wake.wait_for(lock, m_flushInterval);
+                    if (!m_stopping && !m_queue.empty() &&
+                        std::chrono::steady_clock::now() - m_oldest >= m_flushInterval)
+                        Send();
+                }
+            }
+
+            // Turns "<timestamp> Level: text\n" into an RFC 5424 message
+            std::string Syslog(Level level, const std::string &s)
+            {
+                int severity = 6;
+                switch (level)
+                {
+                case Level::Info:       severity = 6; break;
+                case Level::Debug:      severity = 7; break;
+                case Level::Warning:    severity = 4; break;
+                case Level::Error:      severity = 3; break;
+                }
+
+                auto space = s.find(' ');
+                if (space == std::string::npos) space = 0;
+                size_t end = s.size();
+                if (end > 0 && s[end - 1] == '\n') end--;
+
+                std::string out = "<" + std::to_string(8 + severity) + ">1 ";
+                out.append(s, 0, space);
+                out += m_syslogHeader;
+                if (space < end) out.append(s, space + 1, end - space - 1);
+
+                // Stream sockets need framing, datagrams are one message each
+                if (m_type == SocketType::UnixStream) out = std::to_string(out.size()) + " " + out;
+                return out;
+            }
+
+            bool Connect()
+            {
+                auto now = std::chrono::steady_clock::now();
+                if (now < m_nextConnect) return false;
+
+                int domain = m_type == SocketType::Udp ? AF_INET : AF_UNIX;
+                int type = m_type == SocketType::UnixStream ? SOCK_STREAM : SOCK_DGRAM;
+                m_socket = socket(domain, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+                if (m_socket >= 0 &&
+                    (connect(m_socket, reinterpret_cast<sockaddr *>(&m_address), m_addressLength) == 0 || errno == EINPROGRESS))
+                {
+                    m_backoff = MinBackoff();
+                    return true;
+                }
+
+                Disconnect();
+                m_nextConnect = now + m_backoff;
+                m_backoff = std::min(m_backoff * 2, MaxBackoff());
+                return false;
+            }
+
+            void Disconnect()
+            {
+                if (m_socket >= 0) close(m_socket);
+                m_socket = -1;
+
+                // Can't resume half a message on a new stream connection
+                if (m_partial > 0 && !m_queue.empty())
+                {
+                    m_queue.pop_front();
+                    m_dropped++;
+                }
+                m_partial = 0;
+            }
+
+            // Sends as much of the queue as the socket will take right now, must hold destinationMutex.
+            // Whatever is left waits another flush interval rather than being retried on every Write.
+            void Send()
+            {
+                SendQueued();
+                if (!m_queue.empty()) m_oldest = std::chrono::steady_clock::now();
+            }
+
+            void SendQueued()
+            {
+                while (!m_queue.empty())
+                {
+                    if (m_socket < 0 && !Connect()) return;
+
+                    size_t count = std::min(m_queue.size(), m_batchSize);
+                    std::vector<mmsghdr> messages(count);
+                    std::vector<iovec> buffers(count);
+                    for (size_t i = 0; i < count; i++)
+                    {
+                        const std::string &s = m_queue[i];
+                        size_t offset = i == 0 ? m_partial : 0;
+                        buffers[i].iov_base = const_cast<char *>(s.data() + offset);
+                        buffers[i].iov_len = s.size() - offset;
+                        std::memset(&messages[i], 0, sizeof(mmsghdr));
+                        messages[i].msg_hdr.msg_iov = &buffers[i];
+                        messages[i].msg_hdr.msg_iovlen = 1;
+                    }
+
+                    int sent = sendmmsg(m_socket, messages.data(), static_cast<unsigned int>(count), MSG_DONTWAIT | MSG_NOSIGNAL);
+                    if (sent < 0)
+                    {
+                        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return;
+                        if (errno == EMSGSIZE)
+                        {
+                            // Too big to ever go as a datagram
+                            m_queue.pop_front();
+                            m_dropped++;
+                            continue;
+                        }
+                        // Collector went away, keep the queue and try again after backing off
+                        Disconnect();
+                        m_nextConnect = std::chrono::steady_clock::now() + m_backoff;
+                        m_backoff = std::min(m_backoff * 2, MaxBackoff());
+                        return;
+                    }
+
+                    for (int i = 0; i < sent; i++)
+                    {
+                        // Stream sockets can take part of a message, remember where we got to
+                        if (messages[i].msg_len < buffers[i].iov_len)
+                        {
+                            m_partial += messages[i].msg_len;
+                            return;
+                        }
+                        m_queue.pop_front();
+                        m_partial = 0;
+                    }
+                    if (static_cast<size_t>(sent) < count) return;
+                }
+            }
+
+            SocketType m_type;
+            SocketFormat m_format;
+            size_t m_batchSize;
+            size_t m_maxQueued;
+            std::chrono::milliseconds m_flushInterval;
+            sockaddr_storage m_address;
+            socklen_t m_addressLength;
+            std::string m_syslogHeader;
+
+            int m_socket;
+            size_t m_partial;                       // Bytes of the front message already sent on a stream
+            std::deque<std::string> m_queue;
+            std::chrono::steady_clock::time_point m_oldest;
+            std::chrono::milliseconds m_backoff;
+            std::chrono::steady_clock::time_point m_nextConnect;
+            std::atomic<uint64_t> m_dropped;
+
+            bool m_stopping;
+            std::condition_variable m_wake;
+            std::thread m_flusher;
+        };
+#endif
+
         // types for adding extra info to a log message in the form of name value pairs
         typedef std::pair<std::string, std::string> I;
         typedef std::list<I> InfoBlob;
         
 
+        // Adds a name value pair to the text of a Data section
+        static void AppendInfo(std::string &data, const I &info)
+        {
+            if (!data.empty()) data += ", ";
+            data += info.first;
+            data += ": ";
+            data += info.second;
+        }
+
+        // Formats the part of a message after the timestamp and before any data e.g. " Info: doing, result."
+        static std::string MessageText(Level level, const std::string &doing, const std::string &result)
+        {
+            std::stringstream s;
+            s << " " << level << ": " << doing;
+            if (result.size() > 0)
+                s << ", " << result << ".";
+            else
+                s << ".";
+            return s.str();
+        }
+
+        // Per thread stack of info attached to every message logged from that thread, see ScopedContext.
+        // Pairs are kept formatted in one buffer that's reused as scopes come and go, so logging only
+        // appends a string and pushing and popping don't depend on how much is logged.
+        class Context
+        {
+        public:
+            static Context &Current()
+            {
+                thread_local Context context;
+                return context;
+            }
+
+            // This thread's context if it's in use, nullptr if it hasn't been created yet or has
+            // already been destroyed e.g. when logging from static destructors at exit
+            static const Context *Find()
+            {
+                return State() == Alive ? &Current() : nullptr;
+            }
+
+            Context()
+            {
+                State() = Alive;
+            }
+
+            ~Context()
+            {
+                State() = Destroyed;
+            }
+
+            void Push(std::initializer_list<I> data)
+            {
+                m_frames.push_back(m_text.size());
+                for (auto &i : data)
+                {
+                    AppendInfo(m_text, i);
+                }
+            }
+
+            void Pop()
+            {
+                if (m_frames.empty()) return;
+                m_text.resize(m_frames.back());
+                m_frames.pop_back();
+            }
+
+            // The pairs as they appear in a Data section
+            const std::string &Text() const
+            {
+                return m_text;
+            }
+
+        private:
+            enum { Unused, Alive, Destroyed };
+
+            // Trivially destructible, so still readable after the Context itself has gone
+            static int &State()
+            {
+                thread_local int state = Unused;
+                return state;
+            }
+
+            std::string m_text;
+            std::vector<size_t> m_frames;       // Length of m_text before each push
+        };
+
+        // Adds info to every message logged from this thread until the end of the scope, e.g.
+        //
+        //      ScopedContext context{ I("request_id", id) };
+        class ScopedContext
+        {
+        public:
+            ScopedContext(std::initializer_list<I> data)
+            {
+                Context::Current().Push(data);
+            }
+
+            ~ScopedContext()
+            {
+                if (Context::Find()) Context::Current().Pop();
+            }
+
+            ScopedContext(const ScopedContext &) = delete;
+            ScopedContext &operator=(const ScopedContext &) = delete;
+        };
+
+        // Info blob formatted once up front, for info that is attached to many messages
+        class PreparedBlob
+        {
+        public:
+            PreparedBlob() {}
+
+            explicit PreparedBlob(const InfoBlob &blob)
+            {
+                for (auto &i : blob)
+                {
+                    AppendInfo(m_text, i);
+                }
+            }
+
+            explicit PreparedBlob(std::initializer_list<I> data) : PreparedBlob(InfoBlob(data)) {}
+
+            // The pairs as they appear in a Data section e.g. "name: value, name2: value2"
+            const std::string &Text() const
+            {
+                return m_text;
+            }
+
+        private:
+            std::string m_text;
+        };
+
+        // Message formatted once up front, so logging it again only costs the timestamp and any extra info.
+        // Made with the level's factory, so a Debug message always has a debug level, e.g.
+        //
+        //      auto handled = PreparedMessage::Info("Handling request", "done");
+        //      auto parsed = PreparedMessage::Debug(2, "Handling request", "parsed headers");
+        class PreparedMessage
+        {
+        public:
+            static PreparedMessage Info(const std::string &doing, const std::string &result, const PreparedBlob &blob = PreparedBlob())
+            {
+                return PreparedMessage(Level::Info, 0, doing, result, blob);
+            }
+
+            static PreparedMessage Warning(const std::string &doing, const std::string &result, const PreparedBlob &blob = PreparedBlob())
+            {
+                return PreparedMessage(Level::Warning, 0, doing, result, blob);
+            }
+
+            static PreparedMessage Error(const std::string &doing, const std::string &result, const PreparedBlob &blob = PreparedBlob())
+            {
+                return PreparedMessage(Level::Error, 0, doing, result, blob);
+            }
+
+            // Only logged if debugLevel is within the global debug level
+            static PreparedMessage Debug(int debugLevel, const std::string &doing, const std::string &result, const PreparedBlob &blob = PreparedBlob())
+            {
+                return PreparedMessage(Level::Debug, debugLevel, doing, result, blob);
+            }
+
+            Level GetLevel() const
+            {
+                return m_level;
+            }
+
+            int GetDebugLevel() const
+            {
+                return m_debugLevel;
+            }
+
+            const std::string &Text() const
+            {
+                return m_text;
+            }
+
+            const std::string &Data() const
+            {
+                return m_data;
+            }
+
+        private:
+            PreparedMessage(
+                Level level,
+                int debugLevel,
+                const std::string &doing,
+                const std::string &result,
+                const PreparedBlob &blob) :
+                m_level(level),
+                m_debugLevel(debugLevel),
+                m_text(MessageText(level, doing, result)),
+                m_data(blob.Text())
+            {
+            }
+
+            Level m_level;
+            int m_debugLevel;
+            std::string m_text;
+            std::string m_data;
+        };
+
         // Generates timestamps for log messages
         static std::string Timestamp()
         {
@@ -141,21 +676,133 @@ namespace Wild
             s << std::put_time(&tm, "%Y-%m-%dT%H:%M:%SZ");
 #else
             // only gcc > 5 supports put_time, so use alternate method
-            std::tm *tm = gmtime(&now);
+            // gmtime_r as gmtime's shared result isn't safe with several threads logging
+            std::tm tm;
+            gmtime_r(&now, &tm);
             char buffer[256];
-            strftime(buffer, 256, "%Y-%m-%dT%H:%M:%SZ", tm);
+            strftime(buffer, 256, "%Y-%m-%dT%H:%M:%SZ", &tm);
             s << buffer;
 #endif
            
             return s.str();
         }
 
+        // Lock free histogram of durations for one timing site, see ScopedTimer.
+        // Buckets are log-linear, 8 per power of two, so percentiles are accurate to about 12%.
+        class DurationMetric
+        {
+        public:
+
+            // Durations are in nanoseconds
+            struct Summary
+            {
+                uint64_t window;    // Time covered by the summary
+                uint64_t count;
+                uint64_t p50;
+                uint64_t p99;
+                uint64_t max;
+            };
+
+            DurationMetric(const std::string &name) :
+                m_name(name),
+                m_max(0),
+                m_windowStart(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count())
+            {
+                for (auto &bucket : m_buckets) bucket.store(0, std::memory_order_relaxed);
+            }
+
+            const std::string &Name() const
+            {
+                return m_name;
+            }
+
+            // Adds a duration, reporting is left to the Logger's reporter thread
+            void Record(std::chrono::nanoseconds duration)
+            {
+                uint64_t nanoseconds = duration.count() > 0 ? static_cast<uint64_t>(duration.count()) : 0;
+                m_buckets[Bucket(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+                uint64_t max = m_max.load(std::memory_order_relaxed);
+                while (nanoseconds > max && !m_max.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed)) {}
+            }
+
+            // Summarises everything recorded since the last call and starts again
+            Summary Take(int64_t now)
+            {
+                uint64_t counts[BucketCount];
+                uint64_t total = 0;
+                for (size_t i = 0; i < BucketCount; i++)
+                {
+                    counts[i] = m_buckets[i].exchange(0, std::memory_order_relaxed);
+                    total += counts[i];
+                }
+
+                int64_t start = m_windowStart.exchange(now, std::memory_order_relaxed);
+                Summary summary = { static_cast<uint64_t>(now > start ? now - start : 0), total, 0, 0, m_max.exchange(0, std::memory_order_relaxed) };
+                summary.p50 = std::min(Percentile(counts, total, 50), summary.max);
+                summary.p99 = std::min(Percentile(counts, total, 99), summary.max);
+                return summary;
+            }
+
+        private:
+
+            static const size_t BucketCount = 496;
+
+            static size_t Bucket(uint64_t v)
+            {
+                if (v < 8) return static_cast<size_t>(v);
+#if defined(_MSC_VER) && defined(_WIN64)
+                unsigned long e;
+                _BitScanReverse64(&e, v);
+#elif defined(_MSC_VER)
+                // No 64 bit scan on 32 bit Windows, use the half that has the top bit
+                unsigned long e;
+                if (v >> 32)
+                {
+                    _BitScanReverse(&e, static_cast<unsigned long>(v >> 32));
+                    e += 32;
+                }
+                else
+                {
+                    _BitScanReverse(&e, static_cast<unsigned long>(v));
+                }
+#else
+                unsigned long e = 63 - __builtin_clzll(v);
+#endif
+                return (e - 2) * 8 + ((v >> (e - 3)) & 7);
+            }
+
+            // Largest value that lands in the bucket
+            static uint64_t UpperBound(size_t bucket)
+            {
+                if (bucket < 8) return bucket;
+                size_t e = bucket / 8 + 2;
+                return ((8 + bucket % 8) << (e - 3)) + (uint64_t(1) << (e - 3)) - 1;
+            }
+
+            static uint64_t Percentile(const uint64_t *counts, uint64_t total, uint64_t percent)
+            {
+                uint64_t rank = (total * percent + 99) / 100;
+                uint64_t seen = 0;
+                for (size_t i = 0; i < BucketCount; i++)
+                {
+                    seen += counts[i];
+                    if (seen >= rank && seen > 0) return UpperBound(i);
+                }
+                return 0;
+            }
+
+            std::string m_name;
+            std::atomic<uint64_t> m_buckets[BucketCount];
+            std::atomic<uint64_t> m_max;
+            std::atomic<int64_t> m_windowStart;    // steady_clock nanoseconds when the current summary started
+        };
+
         // Class that drives the logging process, maintains destinations and routes messages to them.
         // Not designed to be directly used by the user application.
         class Logger
         {
         public:
-            Logger() {}
+            Logger() : m_debugLevel(0), m_metricsInterval(std::chrono::seconds(60)), m_reporterStopping(false) {}
             static Logger& instance()
             {
                 static Logger instance;
@@ -170,6 +817,15 @@ namespace Wild
 
             void Shutdown()
             {
+                StopReporter();
+
+                // Don't lose timings gathered since the last summary
+                ReportMetrics();
+
+                // Destinations the application still holds won't be destroyed here, so make sure
+                // anything they've queued goes out now
+                Flush();
+
                 for (auto &destinations : m_destinations)
                 {
                     for (std::shared_ptr<Destination> &i : destinations.second)
@@ -216,6 +872,50 @@ namespace Wild
                 }
             }
 
+#ifdef __linux__
+            // Adds a destination that sends messages to a local log collector over a socket
+            //
+            //      type    unix datagram, unix stream or udp
+            //      address path of the unix socket or ipv4:port for udp
+            //      format  native text or RFC 5424 syslog
+            //      levels  specifies the log levels that should be passed to this destination
+            //
+            // Returns the destination so the caller can check Dropped()
+            std::shared_ptr<SocketDestination> AddSocketDestination(
+                SocketType type,
+                const std::string &address,
+                SocketFormat format = SocketFormat::Native,
+                std::initializer_list<Level> levels = { Level::Info, Level::Warning, Level::Error, Level::Debug })
+            {
+                auto destination = std::make_shared<SocketDestination>(type, address, format);
+                AddDestination(destination, levels);
+                return destination;
+            }
+#endif
+
+            // Adds a destination the caller has created e.g. a SocketDestination with a custom batch size
+            //
+            //      levels  specifies the log levels that should be passed to this destination
+            void AddDestination(std::shared_ptr<Destination> destination, std::initializer_list<Level> levels = { Level::Info, Level::Warning, Level::Error, Level::Debug })
+            {
+                for (auto level : levels)
+                {
+                    m_destinations[level].push_back(destination);
+                }
+            }
+
+            // Pushes out any messages that destinations are holding on to
+            void Flush()
+            {
+                for (auto &destinations : m_destinations)
+                {
+                    for (std::shared_ptr<Destination> &i : destinations.second)
+                    {
+                        if (i) i->Flush();
+                    }
+                }
+            }
+
             // Sets the global debug level
             void SetDebugLevel(int debugLevel)
             {
@@ -236,32 +936,49 @@ namespace Wild
                 const std::string &result,
                 const InfoBlob &blob)
             {
-                std::stringstream s;
-                s << Timestamp() << " " << level << ": " << doing;
-                if (result.size() > 0)
-                    s << ", " << result << ".";
-                else
-                    s << ".";
-                if (blob.size() > 0)
+                std::string data;
+                for (auto &i : blob)
                 {
-                    s << " Data {";
-                    auto i = blob.begin();
-                    while (i != blob.end())
-                    {
-                        s << i->first << ": " << i->second;
-                        i++;
-                        if (i != blob.end()) s << ", ";
-                    }
-                    s << "}";
+                    AppendInfo(data, i);
                 }
+                Write(level, Timestamp() + MessageText(level, doing, result), data);
+            }
 
-                s << std::endl;
+            // Logs with prebuilt info plus info for this message only
+            void Log(
+                Level level,
+                const std::string &doing,
+                const std::string &result,
+                const PreparedBlob &blob,
+                const std::initializer_list<I> &extra)
+            {
+                std::string data = blob.Text();
+                for (auto &i : extra)
+                {
+                    AppendInfo(data, i);
+                }
+                Write(level, Timestamp() + MessageText(level, doing, result), data);
+            }
 
-                auto destinations = m_destinations[level];
-                for (auto &i : destinations)
+            // Logs a prepared message, only the timestamp and any extra info are formatted per call.
+            // Debug messages are checked against the debug level.
+            void Log(const PreparedMessage &message, const std::initializer_list<I> &extra)
+            {
+                if (message.GetLevel() == Level::Debug && message.GetDebugLevel() > m_debugLevel)
+                    return;
+
+                if (extra.size() == 0)
                 {
-                    i->Write(s.str());
+                    Write(message.GetLevel(), Timestamp() + message.Text(), message.Data());
+                    return;
                 }
+
+                std::string data = message.Data();
+                for (auto &i : extra)
+                {
+                    AppendInfo(data, i);
+                }
+                Write(message.GetLevel(), Timestamp() + message.Text(), data);
             }
 
             // Checks the debug level before logging
@@ -275,11 +992,194 @@ namespace Wild
                     Log(Level::Debug, doing, result, blob);
             }
 
+            void Debug(
+                int debugLevel,
+                const std::string &doing,
+                const std::string &result,
+                const PreparedBlob &blob,
+                const std::initializer_list<I> &extra)
+            {
+                if (debugLevel <= m_debugLevel)
+                    Log(Level::Debug, doing, result, blob, extra);
+            }
+
+            // Returns the timing metric for a site, creating it the first time.
+            // Lookup takes a lock so keep hold of the reference e.g. in a function static.
+            // The first metric starts a reporter thread that logs summaries every interval.
+            DurationMetric &Metric(const std::string &name)
+            {
+                std::lock_guard<std::mutex> lock(m_metricsMutex);
+                auto &metric = m_metrics[name];
+                if (!metric) metric.reset(new DurationMetric(name));
+
+                std::lock_guard<std::mutex> reporterLock(m_reporterMutex);
+                if (!m_reporter.joinable() && !m_reporterStopping)
+                    m_reporter = std::thread([this]() { ReportPeriodically(); });
+                return *metric;
+            }
+
+            // Sets how often metric summaries are logged, at least every millisecond
+            void SetMetricsInterval(std::chrono::milliseconds interval)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_reporterMutex);
+                    m_metricsInterval = std::max(interval, std::chrono::milliseconds(1));
+                }
+                m_reporterWake.notify_one();
+            }
+
+            // Logs one Info line summarising a metric since its last summary, nothing if it's had no records
+            void Report(DurationMetric &metric)
+            {
+                auto summary = metric.Take(SteadyNanoseconds());
+                if (summary.count == 0) return;
+
+                InfoBlob blob = {
+                    I("window_s", Tenths(summary.window, 1000000000)),
+                    I("count", std::to_string(summary.count)),
+                    I("p50_us", Microseconds(summary.p50)),
+                    I("p99_us", Microseconds(summary.p99)),
+                    I("max_us", Microseconds(summary.max)) };
+                std::string data;
+                for (auto &i : blob)
+                {
+                    AppendInfo(data, i);
+                }
+
+                // A summary covers every thread's timings, so the context of the thread that happens to
+                // report doesn't belong on it
+                Write(Level::Info, Timestamp() + MessageText(Level::Info, metric.Name(), "timing summary"), data, std::string());
+            }
+
+            // Logs summaries for all metrics now rather than waiting for the interval
+            void ReportMetrics()
+            {
+                std::lock_guard<std::mutex> lock(m_metricsMutex);
+                for (auto &metric : m_metrics)
+                {
+                    Report(*metric.second);
+                }
+            }
+
         private:
 
+            // Runs on m_reporter, logs every metric's summary once per interval
+            void ReportPeriodically()
+            {
+                std::unique_lock<std::mutex> lock(m_reporterMutex);
+                auto last = std::chrono::steady_clock::now();
+                while (!m_reporterStopping)
+                {
+                    // Recalculated each time round in case the interval has been changed
+                    auto next = last + m_metricsInterval;
+                    if (std::chrono::steady_clock::now() < next)
+                    {
+                        m_reporterWake.wait_until(lock, next);
+                        continue;
+                    }
+
+                    last = std::chrono::steady_clock::now();
+                    lock.unlock();
+                    ReportMetrics();
+                    lock.lock();
+                }
+            }
+
+            void StopReporter()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_reporterMutex);
+                    m_reporterStopping = true;
+                }
+                m_reporterWake.notify_one();
+                if (m_reporter.joinable()) m_reporter.join();
+            }
+
+            // Finishes a message with its Data section, including this thread's context, and passes
+            // it to the destinations for the level
+            void Write(Level level, std::string message, const std::string &data)
+            {
+                const Context *context = Context::Find();
+                Write(level, std::move(message), data, context ? context->Text() : std::string());
+            }
+
+            void Write(Level level, std::string message, const std::string &data, const std::string &context)
+            {
+                if (!data.empty() || !context.empty())
+                {
+                    message += " Data {";
+                    message += data;
+                    if (!data.empty() && !context.empty()) message += ", ";
+                    message += context;
+                    message += "}";
+                }
+                message += "\n";
+
+                auto &destinations = m_destinations[level];
+                for (auto &i : destinations)
+                {
+                    if (i) i->Write(level, message);
+                }
+            }
+
+            static int64_t SteadyNanoseconds()
+            {
+                return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+            }
+
+            // Formats value / unit to one decimal place
+            static std::string Tenths(uint64_t value, uint64_t unit)
+            {
+                return std::to_string(value / unit) + "." + std::to_string(value % unit / (unit / 10));
+            }
+
+            static std::string Microseconds(uint64_t nanoseconds)
+            {
+                return Tenths(nanoseconds, 1000);
+            }
+
             // Maps Level to list of Destinations
             std::map<Level, std::vector<std::shared_ptr<Destination>>> m_destinations;
             int m_debugLevel;
+
+            // Timing metrics by name, see ScopedTimer
+            std::mutex m_metricsMutex;
+            std::map<std::string, std::unique_ptr<DurationMetric>> m_metrics;
+
+            // Reporter thread, started with the first metric
+            std::mutex m_reporterMutex;
+            std::condition_variable m_reporterWake;
+            std::chrono::milliseconds m_metricsInterval;
+            bool m_reporterStopping;
+            std::thread m_reporter;
+        };
+
+        // Times the enclosing scope and adds it to a metric, the Logger emits one summary
+        // line per metric per interval instead of a line per measurement. E.g.
+        //
+        //      static DurationMetric &metric = Metric("Handling request");
+        //      ScopedTimer timer(metric);
+        class ScopedTimer
+        {
+        public:
+            ScopedTimer(DurationMetric &metric) :
+                m_metric(metric),
+                m_start(std::chrono::steady_clock::now())
+            {
+            }
+
+            ~ScopedTimer()
+            {
+                m_metric.Record(std::chrono::steady_clock::now() - m_start);
+            }
+
+            ScopedTimer(const ScopedTimer &) = delete;
+            ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+        private:
+
+            DurationMetric &m_metric;
+            std::chrono::steady_clock::time_point m_start;
         };
 
         // Helper function for level specific log functions e.g. Info
@@ -306,6 +1206,25 @@ namespace Wild
             Logger::instance().Log(level, doing, result, b);
         }
 
+        // Helper function for level specific log functions with a prepared blob
+        static void Log(
+            Level level,
+            const std::string &doing,
+            const std::string &result,
+            const PreparedBlob &blob,
+            const std::initializer_list<I> &data = {})
+        {
+            Logger::instance().Log(level, doing, result, blob, data);
+        }
+
+        // Logs a prepared message at its level, data is added for this message only
+        static void Log(
+            const PreparedMessage &message,
+            const std::initializer_list<I> &data = {})
+        {
+            Logger::instance().Log(message, data);
+        }
+
 
 
         // Functions below here are intended to form the public interface of the library ------------------
@@ -325,6 +1244,30 @@ namespace Wild
             Logger::instance().Shutdown();
         }
 
+        // Pushes out any messages that destinations are holding on to e.g. a partly filled socket batch
+        static void FlushLogging()
+        {
+            Logger::instance().Flush();
+        }
+
+        // Timing metric for a site, see ScopedTimer
+        static DurationMetric &Metric(const std::string &name)
+        {
+            return Logger::instance().Metric(name);
+        }
+
+        // Sets how often timing summaries are logged, default is every 60 seconds
+        static void SetMetricsInterval(std::chrono::milliseconds interval)
+        {
+            Logger::instance().SetMetricsInterval(interval);
+        }
+
+        // Logs timing summaries now e.g. before exiting
+        static void ReportMetrics()
+        {
+            Logger::instance().ReportMetrics();
+        }
+
         static void SetDebugLevel(int debugLevel)
         {
             Logger::instance().SetDebugLevel(debugLevel);
@@ -342,6 +1285,17 @@ namespace Wild
             Logger::instance().AddFileDestination(filePath);
         }
 
+#ifdef __linux__
+        // Creates socket destination for all levels, see SocketDestination
+        static std::shared_ptr<SocketDestination> AddSocketDestination(
+            SocketType type,
+            const std::string &address,
+            SocketFormat format = SocketFormat::Native)
+        {
+            return Logger::instance().AddSocketDestination(type, address, format);
+        }
+#endif
+
         // Info message
         static void Info(
             const std::string &doing,
@@ -377,6 +1331,25 @@ namespace Wild
             Log(Level::Info, doing, result, blob, data);
         }
 
+        // Info message with prepared blob
+
+        static void Info(
+            const std::string &info,
+            const PreparedBlob &blob,
+            const std::initializer_list<I> &data = {})
+        {
+            Log(Level::Info, info, "", blob, data);
+        }
+
+        static void Info(
+            const std::string &doing,
+            const std::string &result,
+            const PreparedBlob &blob,
+            const std::initializer_list<I> &data = {})
+        {
+            Log(Level::Info, doing, result, blob, data);
+        }
+
         static void Warning(
             const std::string &doing,
             const std::string &result,
@@ -394,6 +1367,15 @@ namespace Wild
             Log(Level::Warning, doing, result, blob, data);
         }
 
+        static void Warning(
+            const std::string &doing,
+            const std::string &result,
+            const PreparedBlob &blob,
+            const std::initializer_list<I> &data = {})
+        {
+            Log(Level::Warning, doing, result, blob, data);
+        }
+
         static void Error(
             const std::string &doing,
             const std::string &result,
@@ -411,6 +1393,15 @@ namespace Wild
             Log(Level::Error, doing, result, blob, data);
         }
 
+        static void Error(
+            const std::string &doing,
+            const std::string &result,
+            const PreparedBlob &blob,
+            const std::initializer_list<I> &data = {})
+        {
+            Log(Level::Error, doing, result, blob, data);
+        }
+
         static void Debug(
             int debugLevel,
             const std::string &doing,
@@ -452,6 +1443,25 @@ namespace Wild
             b.insert(b.end(), data);
             Logger::instance().Debug(debugLevel, doing, result, b);
         }
+
+        static void Debug(
+            int debugLevel,
+            const std::string &debug,
+            const PreparedBlob &blob,
+            const std::initializer_list<I> &data = {})
+        {
+            Logger::instance().Debug(debugLevel, debug, "", blob, data);
+        }
+
+        static void Debug(
+            int debugLevel,
+            const std::string &doing,
+            const std::string &result,
+            const PreparedBlob &blob,
+            const std::initializer_list<I> &data = {})
+        {
+            Logger::instance().Debug(debugLevel, doing, result, blob, data);
+        }
 	}
 }
 
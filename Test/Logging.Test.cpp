@@ -73,6 +73,136 @@ void TestLogging()
         allLines.back() + "\n");
 }
 
+// Keeps messages in memory, safe to read while other threads are logging
+class MemoryDestination : public Destination
+{
+public:
+    void Write(const std::string &s)
+    {
+        std::lock_guard<std::mutex> lock(destinationMutex);
+        messages += s;
+    }
+
+    string Messages()
+    {
+        std::lock_guard<std::mutex> lock(destinationMutex);
+        return messages;
+    }
+
+private:
+    string messages;
+};
+
+void TestPreparedMessages()
+{
+    PreparedBlob b(InfoBlob({ I("1", "2"), I("3", "4") }));
+
+    allLines.push_back(Timestamp() + " Info: Starting application, startup successful. Data {1: 2, 3: 4}");
+    AssertPrints(
+        Info("Starting application", "startup successful", b),
+        allLines.back() + "\n");
+
+    allLines.push_back(Timestamp() + " Warning: Starting application, it's slow. Data {1: 2, 3: 4, foo: bar}");
+    AssertPrints(
+        Warning("Starting application", "it's slow", b, { I("foo", "bar") }),
+        allLines.back() + "\n");
+
+    auto started = PreparedMessage::Info("Started application", "", b);
+    allLines.push_back(Timestamp() + " Info: Started application. Data {1: 2, 3: 4}");
+    AssertPrints(
+        Log(started),
+        allLines.back() + "\n");
+
+    allLines.push_back(Timestamp() + " Info: Started application. Data {1: 2, 3: 4, Kung Fu: Hustle}");
+    AssertPrints(
+        Log(started, { I("Kung Fu", "Hustle") }),
+        allLines.back() + "\n");
+
+    auto plain = PreparedMessage::Info("Handling request", "done");
+    allLines.push_back(Timestamp() + " Info: Handling request, done. Data {id: 7}");
+    AssertPrints(
+        Log(plain, { I("id", "7") }),
+        allLines.back() + "\n");
+
+    // Debug level is 0 here
+    auto detail = PreparedMessage::Debug(1, "Handling request", "detail");
+    AssertPrints(Log(detail), "");
+
+    auto always = PreparedMessage::Debug(0, "Handling request", "always");
+    allLines.push_back(Timestamp() + " Debug: Handling request, always.");
+    AssertPrints(
+        Log(always),
+        allLines.back() + "\n");
+
+    // A standalone Logger starts at debug level 0 too
+    Logger logger;
+    logger.AddStdoutDestination();
+    AssertPrints(logger.Log(detail, {}), "");
+
+}
+
+// Logs from a thread local destructor
+struct LogsOnThreadExit
+{
+    Logger *logger = nullptr;
+
+    ~LogsOnThreadExit()
+    {
+        if (logger) logger->Log(Level::Info, "Exiting thread", "", {});
+    }
+};
+
+void TestContext()
+{
+    {
+        ScopedContext request{ I("request_id", "42") };
+
+        allLines.push_back(Timestamp() + " Info: Handling request. Data {request_id: 42}");
+        AssertPrints(
+            Info("Handling request"),
+            allLines.back() + "\n");
+
+        {
+            ScopedContext user{ I("user", "dave"), I("role", "admin") };
+
+            allLines.push_back(Timestamp() + " Info: Handling request, authorised. Data {foo: bar, request_id: 42, user: dave, role: admin}");
+            AssertPrints(
+                Info("Handling request", "authorised", { I("foo", "bar") }),
+                allLines.back() + "\n");
+        }
+
+        allLines.push_back(Timestamp() + " Info: Handling request, done. Data {1: 2, request_id: 42}");
+        AssertPrints(
+            Log(PreparedMessage::Info("Handling request", "done", PreparedBlob{ I("1", "2") })),
+            allLines.back() + "\n");
+
+        // Context belongs to the thread that set it
+        string other = "unset";
+        thread t([&other]() { other = Context::Current().Text(); });
+        t.join();
+        AssertEquals(other, "");
+    }
+
+    // Logging after the thread's context is destroyed, e.g. from a later thread local destructor,
+    // just leaves the context out
+    Logger logger;
+    auto memory = make_shared<MemoryDestination>();
+    logger.AddDestination(memory);
+    thread exiting([&logger]() {
+        thread_local LogsOnThreadExit guard;    // Made before the Context so destroyed after it
+        guard.logger = &logger;
+        Context::Current().Push({ I("request_id", string(64, '7')) });
+    });
+    exiting.join();
+    AssertTrue(memory->Messages().find(" Info: Exiting thread.\n") != string::npos);
+    AssertTrue(memory->Messages().find("request_id") == string::npos);
+
+    allLines.push_back(Timestamp() + " Info: Handled request.");
+    AssertPrints(
+        Info("Handled request"),
+        allLines.back() + "\n");
+}
+
 void TestDebugging()
 {
     std::stringstream output;
@@ -160,6 +290,60 @@ void TestThreadedBehaviour()
 
 }
 
+void TestMetrics()
+{
+    Logger logger;
+    logger.AddStdoutDestination();
+    DurationMetric &metric = logger.Metric("Handling request");
+    AssertTrue(&metric == &logger.Metric("Handling request"));
+
+    // Nothing recorded, nothing logged
+    AssertPrints(logger.ReportMetrics(), "");
+
+    for (int i = 0; i < 100; i++)
+        metric.Record(chrono::microseconds(1));
+    metric.Record(chrono::milliseconds(1));
+
+    stringstream summary;
+    streambuf* original = std::cout.rdbuf(summary.rdbuf());
+    logger.ReportMetrics();
+    std::cout.rdbuf(original);
+    AssertTrue(summary.str().find(" Info: Handling request, timing summary. Data {window_s: ") != string::npos);
+    AssertTrue(summary.str().find(", count: 101, p50_us: 1.0, p99_us: 1.0, max_us: 1000.0}\n") != string::npos);
+
+    // Summary resets after being logged
+    AssertPrints(logger.ReportMetrics(), "");
+
+    stringstream output;
+    original = std::cout.rdbuf(output.rdbuf());
+    {
+        ScopedTimer timer(metric);
+    }
+    logger.ReportMetrics();
+    std::cout.rdbuf(original);
+    AssertTrue(output.str().find(", count: 1, p50_us: ") != string::npos);
+
+    // Summaries cover all requests so don't pick up the reporting thread's context
+    stringstream untagged;
+    original = std::cout.rdbuf(untagged.rdbuf());
+    {
+        ScopedContext request{ I("request_id", "2") };
+        metric.Record(chrono::microseconds(1));
+        logger.ReportMetrics();
+    }
+    std::cout.rdbuf(original);
+    AssertTrue(untagged.str().find("max_us: 1.0}\n") != string::npos);
+
+    // The reporter thread logs each interval without waiting for another record
+    Logger reported;
+    auto memory = make_shared<MemoryDestination>();
+    reported.AddDestination(memory);
+    reported.SetMetricsInterval(chrono::milliseconds(20));
+    reported.Metric("Quiet site").Record(chrono::microseconds(5));
+    this_thread::sleep_for(chrono::milliseconds(200));
+    AssertTrue(memory->Messages().find("Quiet site, timing summary. Data {window_s: 0.0, count: 1, p50_us: 5.0") != string::npos);
+}
+
 void ReadmeExampleCode()
 {
     string info = "interesting info";
@@ -203,11 +387,15 @@ int main(int argc, char* argv[])
     AddFileDestination(logFileName); // All messages will be written to this file, we'll check them in TestFileOutput
 
     TestLogging();
+    TestPreparedMessages();
+    TestContext();
     TestDebugging();
     AdditionalFileTests();
     TestIndividualLoggers();
+    TestSocketDestination();
 
     TestThreadedBehaviour();
+    TestMetrics();
 
     TestFileOutput();
 
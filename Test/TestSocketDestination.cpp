@@ -0,0 +1,257 @@
+#include "Logging.h"
+#include "UnitTesting.h"
+#include "Tests.h"
+#include <thread>
+
+using namespace Wild::Logging;
+using namespace std;
+
+#ifdef __linux__
+
+// Local collector listening on a unix datagram socket
+static int Listen(const string &path)
+{
+    unlink(path.c_str());
+    int s = socket(AF_UNIX, SOCK_DGRAM, 0);
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path.c_str());
+    bind(s, reinterpret_cast<sockaddr *>(&address), sizeof(address));
+    return s;
+}
+
+// Local collector listening on a unix stream socket
+static int ListenStream(const string &path)
+{
+    unlink(path.c_str());
+    int s = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path.c_str());
+    bind(s, reinterpret_cast<sockaddr *>(&address), sizeof(address));
+    listen(s, 1);
+    return s;
+}
+
+// Accepts a connection and gives up on reads after a second so a failing test can't hang
+static int Accept(int listener)
+{
+    int s = accept(listener, nullptr, nullptr);
+    timeval timeout = { 1, 0 };
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return s;
+}
+
+static string Receive(int s)
+{
+    char buffer[1024];
+    ssize_t n = recv(s, buffer, sizeof(buffer), MSG_DONTWAIT);
+    return n > 0 ? string(buffer, n) : "";
+}
+
+// Reads one octet counted syslog frame, "<length> <message>", from a stream
+static string ReceiveFrame(int s, string &buffer)
+{
+    while (true)
+    {
+        auto space = buffer.find(' ');
+        if (space != string::npos)
+        {
+            size_t length = strtoul(buffer.c_str(), nullptr, 10);
+            if (buffer.size() >= space + 1 + length)
+            {
+                string frame = buffer.substr(space + 1, length);
+                buffer.erase(0, space + 1 + length);
+                return frame;
+            }
+        }
+
+        char chunk[1024];
+        ssize_t n = recv(s, chunk, sizeof(chunk), 0);
+        if (n <= 0) return "";
+        buffer.append(chunk, n);
+    }
+}
+
+static bool EndsWith(const string &s, const string &end)
+{
+    return s.size() >= end.size() && s.compare(s.size() - end.size(), end.size(), end) == 0;
+}
+
+static void TestStreamSocket()
+{
+    string path = "test_stream.sock";
+    int listener = ListenStream(path);
+
+    // Octet counted syslog, several records in one batch
+    auto destination = make_shared<SocketDestination>(SocketType::UnixStream, path, SocketFormat::Syslog, 3, chrono::milliseconds(0));
+    int collector = Accept(listener);
+    destination->Write(Level::Info, "2015-08-26T06:39:29Z Info: Testing stream, first. Data {note: two\nlines}\n");
+    destination->Write(Level::Warning, "2015-08-26T06:39:29Z Warning: Testing stream, second.\n");
+    destination->Write(Level::Error, "2015-08-26T06:39:29Z Error: Testing stream, third.\n");
+
+    string buffer;
+    string frame = ReceiveFrame(collector, buffer);
+    AssertEquals(frame.substr(0, 27), "<14>1 2015-08-26T06:39:29Z ");
+    AssertTrue(EndsWith(frame, " - - Info: Testing stream, first. Data {note: two\nlines}"));
+    AssertTrue(EndsWith(ReceiveFrame(collector, buffer), " - - Warning: Testing stream, second."));
+    AssertTrue(EndsWith(ReceiveFrame(collector, buffer), " - - Error: Testing stream, third."));
+
+    // Collector goes away and comes back, the message queued meanwhile is sent on reconnect
+    close(collector);
+    close(listener);
+    destination->Write(Level::Info, "2015-08-26T06:39:29Z Info: Testing stream, while away.\n");
+    destination->Flush();
+    listener = ListenStream(path);
+    this_thread::sleep_for(chrono::milliseconds(200));  // Past the first reconnect backoff
+    destination->Flush();
+    collector = Accept(listener);
+    buffer.clear();
+    AssertTrue(EndsWith(ReceiveFrame(collector, buffer), " - - Info: Testing stream, while away."));
+    AssertTrue(destination->Dropped() == 0);
+    close(collector);
+    destination.reset();
+
+    // A message too big for the socket buffer goes out in pieces without being mangled
+    auto native = make_shared<SocketDestination>(SocketType::UnixStream, path, SocketFormat::Native, 1, chrono::milliseconds(0));
+    collector = Accept(listener);
+    string big(1 << 20, 'x');
+    native->Write(Level::Info, big + "\n");
+    native->Write(Level::Info, "small\n");
+    string received;
+    while (received.size() < big.size() + 7)
+    {
+        char chunk[65536];
+        ssize_t n = recv(collector, chunk, sizeof(chunk), 0);
+        if (n <= 0) break;
+        received.append(chunk, n);
+        native->Flush();
+    }
+    AssertEquals(received, big + "\nsmall\n");
+    AssertTrue(native->Dropped() == 0);
+
+    // Half a message can't be finished on a new connection, so it's dropped
+    native->Write(Level::Info, big + "\n");
+    close(collector);
+    close(listener);
+    native->Flush();
+    AssertTrue(native->Dropped() == 1);
+    listener = ListenStream(path);
+    this_thread::sleep_for(chrono::milliseconds(200));
+    native->Write(Level::Info, "resumed\n");
+    collector = Accept(listener);
+    char chunk[64];
+    ssize_t n = recv(collector, chunk, sizeof(chunk), 0);
+    AssertEquals(string(chunk, n > 0 ? n : 0), "resumed\n");
+
+    close(collector);
+    close(listener);
+    unlink(path.c_str());
+}
+
+static void TestUdpSocket()
+{
+    int collector = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in address;
+    socklen_t length = sizeof(address);
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(collector, reinterpret_cast<sockaddr *>(&address), sizeof(address));
+    getsockname(collector, reinterpret_cast<sockaddr *>(&address), &length);
+    string port = to_string(ntohs(address.sin_port));
+
+    Logger logger;
+    logger.AddSocketDestination(SocketType::Udp, "127.0.0.1:" + port, SocketFormat::Syslog);
+    string timestamp = Timestamp();
+    logger.Log(Level::Error, "Testing udp", "sent", {});
+    logger.Flush();
+
+    char buffer[1024];
+    ssize_t n = recv(collector, buffer, sizeof(buffer), 0);
+    string message = n > 0 ? string(buffer, n) : "";
+    AssertEquals(message.substr(0, 7 + timestamp.size()), "<11>1 " + timestamp + " ");
+    AssertTrue(EndsWith(message, " - - Error: Testing udp, sent."));
+
+    close(collector);
+}
+
+void TestSocketDestination()
+{
+    string path = "test.sock";
+    int collector = Listen(path);
+
+    // Nothing goes out until the batch is full
+    Logger logger;
+    auto destination = make_shared<SocketDestination>(SocketType::UnixDatagram, path, SocketFormat::Native, 2);
+    logger.AddDestination(destination);
+
+    string line1 = Timestamp() + " Info: Testing socket, first.\n";
+    logger.Log(Level::Info, "Testing socket", "first", {});
+    AssertEquals(Receive(collector), "");
+
+    string line2 = Timestamp() + " Error: Testing socket, second.\n";
+    logger.Log(Level::Error, "Testing socket", "second", {});
+    AssertEquals(Receive(collector), line1);
+    AssertEquals(Receive(collector), line2);
+
+    // Syslog format carries the severity in the priority and the timestamp in the header
+    Logger syslogger;
+    auto syslog = syslogger.AddSocketDestination(SocketType::UnixDatagram, path, SocketFormat::Syslog);
+    string timestamp = Timestamp();
+    syslogger.Log(Level::Warning, "Testing syslog", "sent", {});
+    syslogger.Flush();
+    string message = Receive(collector);
+    AssertEquals(message.substr(0, 7 + timestamp.size()), "<12>1 " + timestamp + " ");
+    string text = " - - Warning: Testing syslog, sent.";
+    AssertEquals(message.substr(message.size() - text.size()), text);
+
+    // A lone message goes out once it has waited the flush interval
+    auto timed = make_shared<SocketDestination>(SocketType::UnixDatagram, path, SocketFormat::Native, 64, chrono::milliseconds(10));
+    timed->Write(Level::Error, "alone\n");
+    this_thread::sleep_for(chrono::milliseconds(200));
+    AssertEquals(Receive(collector), "alone\n");
+
+    // Shutdown sends what's queued even though the application still holds the destination
+    Logger shutdown;
+    auto held = shutdown.AddSocketDestination(SocketType::UnixDatagram, path);
+    string line3 = Timestamp() + " Info: Testing socket, shutting down.\n";
+    shutdown.Log(Level::Info, "Testing socket", "shutting down", {});
+    shutdown.Shutdown();
+    AssertEquals(Receive(collector), line3);
+
+    // A datagram too big to ever send is dropped without holding up the rest
+    auto oversized = make_shared<SocketDestination>(SocketType::UnixDatagram, path, SocketFormat::Native, 1, chrono::milliseconds(0));
+    oversized->Write(Level::Info, string(1 << 20, 'x') + "\n");
+    oversized->Write(Level::Info, "after\n");
+    AssertEquals(Receive(collector), "after\n");
+    AssertTrue(oversized->Dropped() == 1);
+
+    close(collector);
+    unlink(path.c_str());
+
+    // With no collector listening messages are held up to a limit then dropped rather than blocking
+    auto bounded = make_shared<SocketDestination>(SocketType::UnixDatagram, path, SocketFormat::Native, 1);
+    for (int i = 0; i < 20; i++)
+        bounded->Write(Level::Info, "lost\n");
+    AssertTrue(bounded->Dropped() == 4);
+
+    AssertThrows(SocketDestination(SocketType::Udp, "localhost"), std::runtime_error);
+    AssertThrows(SocketDestination(SocketType::Udp, "127.0.0.1:"), std::runtime_error);
+    AssertThrows(SocketDestination(SocketType::Udp, "127.0.0.1:abc"), std::runtime_error);
+    AssertThrows(SocketDestination(SocketType::Udp, "127.0.0.1:0"), std::runtime_error);
+    AssertThrows(SocketDestination(SocketType::Udp, "127.0.0.1:70000"), std::runtime_error);
+
+    TestStreamSocket();
+    TestUdpSocket();
+}
+
+#else
+
+void TestSocketDestination()
+{
+}
+
+#endif
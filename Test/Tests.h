@@ -1,4 +1,5 @@
 #pragma once
 
 void AdditionalFileTests();
-void TestIndividualLoggers();
\ No newline at end of file
+void TestIndividualLoggers();
+void TestSocketDestination();